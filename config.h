@@ -46,3 +46,4 @@
 #define CL_FIFO C_ESC "31m" "|"
 #define CL_SOCK C_ESC "35m" "="
 #define CL_EXEC C_END "*"
+#define CL_TIMEOUT C_ESC "31m" "!" // metadata timed out
@@ -0,0 +1,2186 @@
+/* TODO
+ * refactor width stuff
+ * fix potential verrevcmp overflow
+ * naming, code organization
+ * config file
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "config.h"
+#include "lsc.h"
+#include "util.h"
+
+typedef struct {
+	const char *name, *linkname;
+	mode_t mode, linkmode;
+	id_t uid, gid;
+	time_t time;
+	off_t size;
+	int name_len, linkname_len;
+	int uwidth, gwidth, nwidth;
+	int name_suf;
+	bool linkok;
+	bool timeout; // metadata did not arrive before the deadline
+} file_info;
+
+static void fi_free(file_info *fi) {
+	if (fi->name) free((void *)fi->name);
+	if (fi->linkname) free((void *)fi->linkname);
+}
+
+static int order(char c) {
+	if (ls_isalpha(c)) return c;
+	if (ls_isdigit(c)) return 0;
+	if (c == '~') return -1;
+	return (int)c + 256;
+}
+
+static int verrevcmp(const char *a, const char *b, size_t al, size_t bl) {
+	size_t ai = 0, bi = 0;
+	while (ai < al || bi < bl) {
+		int first_diff = 0;
+		// XXX: heap overflow stuff with afl/asan
+		while ((ai < al && !ls_isdigit(a[ai])) ||
+		       (bi < bl && !ls_isdigit(b[bi]))) {
+			int ac = (ai == al) ? 0 : order(a[ai]);
+			int bc = (bi == bl) ? 0 : order(b[bi]);
+			if (ac != bc) return ac - bc;
+			ai++; bi++;
+		}
+		while (a[ai] == '0') ai++;
+		while (b[bi] == '0') bi++;
+		while (ls_isdigit(a[ai]) && ls_isdigit(b[bi])) {
+			if (!first_diff) first_diff = a[ai] - b[bi];
+			ai++; bi++;
+		}
+		if (ls_isdigit(a[ai])) return 1;
+		if (ls_isdigit(b[bi])) return -1;
+		if (first_diff) return first_diff;
+	}
+	return 0;
+}
+
+// read file extension
+// ^\.?.*?(\.[A-Za-z~][A-Za-z0-9~])*$
+static size_t suf_index(const char *s, size_t len) {
+	if (len != 0 && s[0] == '.') { s++; len--; }
+	bool alpha = false;
+	size_t match = 0;
+	for (size_t j = 0; j < len; j++) {
+		char c = s[len - j - 1];
+		if (ls_isalpha(c) || c == '~')
+			alpha = true;
+		else if (alpha && c == '.')
+			match = j + 1;
+		else if (ls_isdigit(c))
+			alpha = false;
+		else
+			break;
+	}
+	return len - match;
+}
+
+
+static int filevercmp(const char *a, size_t al, size_t ai,
+	const char *b, size_t bl, size_t bi)
+{
+	if (!al || !bl) return !al - !bl;
+	int s = strcmp(a, b);
+	if (!s) return 0;
+	if (a[0] == '.' && b[0] != '.') return -1;
+	if (a[0] != '.' && b[0] == '.') return 1;
+	if (a[0] == '.' && b[0] == '.') a++, al--, b++, bl--;
+	if (ai == bi && !strncmp(a, b, ai)) {
+		a += ai; ai = al - ai;
+		b += bi; bi = bl - bi;
+	}
+	int r = verrevcmp(a, b, ai, bi);
+	return r ? r : s;
+}
+
+#define fi_isdir(fi) (S_ISDIR((fi)->mode) || S_ISDIR((fi)->linkmode))
+
+// terminal graphics state, as far as the output stage needs to know it;
+// fields not in known are unchanged since the start of the line
+struct sgr {
+	bool valid; // false after anything not understood, until a reset
+	uint16_t known, attrs;
+	uint32_t fg, bg;
+};
+
+#define SGR_ATTR(n) (1u << (n))
+#define SGR_FG SGR_ATTR(10)
+#define SGR_BG SGR_ATTR(11)
+#define SGR_ALL 0xfff
+#define SGR_SPACE (SGR_ATTR(4) | SGR_ATTR(7) | SGR_ATTR(9) | SGR_BG)
+
+// whether the fields in mask are the same in both states
+static bool sgr_same(const struct sgr *a, const struct sgr *b, unsigned mask) {
+	if (!a->valid || !b->valid || (a->known & mask) != (b->known & mask))
+		return false;
+	unsigned k = a->known & mask;
+	return !((a->attrs ^ b->attrs) & k & ~(SGR_FG | SGR_BG)) &&
+		(!(k & SGR_FG) || a->fg == b->fg) &&
+		(!(k & SGR_BG) || a->bg == b->bg);
+}
+
+#define sgr_eq(a, b) sgr_same(a, b, SGR_ALL)
+
+static uint32_t sgr_extended(const unsigned *a, size_t n, size_t *k) {
+	if (*k + 2 < n && a[*k + 1] == 5 && a[*k + 2] < 256) {
+		*k += 2;
+		return 0x100 | a[*k];
+	}
+	if (*k + 4 < n && a[*k + 1] == 2 &&
+	    a[*k + 2] < 256 && a[*k + 3] < 256 && a[*k + 4] < 256) {
+		*k += 4;
+		return 1u << 24 | a[*k - 2] << 16 | a[*k - 1] << 8 | a[*k];
+	}
+	return 0;
+}
+
+// apply the parameters of an SGR sequence, anything not understood makes
+// the state unknown until the next full reset; true if there was a reset
+static bool sgr_apply(struct sgr *s, const char *p, size_t n) {
+	bool reset = false;
+	unsigned a[32];
+	size_t na = 0;
+	a[0] = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (p[i] == ';') {
+			if (++na == sizeof(a) / sizeof(*a)) { s->valid = false; return reset; }
+			a[na] = 0;
+		} else if (!ls_isdigit(p[i])) {
+			s->valid = false;
+			return reset;
+		} else if (a[na] < 10000) {
+			a[na] = a[na] * 10 + (p[i] - '0');
+		}
+	}
+	na++;
+	for (size_t k = 0; k < na; k++) {
+		unsigned x = a[k], set = 0, clear = 0;
+		if (x == 0) {
+			*s = (struct sgr) { .valid = true, .known = SGR_ALL };
+			reset = true;
+		}
+		else if (x <= 9) set = SGR_ATTR(x);
+		else if (x == 22) clear = SGR_ATTR(1) | SGR_ATTR(2);
+		else if (x == 23 || x == 24 || x == 27 || x == 28 || x == 29)
+			clear = SGR_ATTR(x - 20);
+		else if (x == 25) clear = SGR_ATTR(5) | SGR_ATTR(6);
+		else if ((x >= 30 && x <= 37) || (x >= 90 && x <= 97) || x == 39)
+			s->fg = x == 39 ? 0 : x, s->known |= SGR_FG;
+		else if ((x >= 40 && x <= 47) || (x >= 100 && x <= 107) || x == 49)
+			s->bg = x == 49 ? 0 : x, s->known |= SGR_BG;
+		else if (x == 38 || x == 48) {
+			uint32_t c = sgr_extended(a, na, &k);
+			if (!c) s->valid = false;
+			else if (x == 38) s->fg = c, s->known |= SGR_FG;
+			else s->bg = c, s->known |= SGR_BG;
+		} else s->valid = false;
+		s->attrs = (s->attrs | set) & ~clear;
+		s->known |= set | clear;
+	}
+	return reset;
+}
+
+// what an SGR sequence does, worked out once so that rendering never parses
+// it: its effect on a blank state, which replaces the state after a reset
+// and is added to it otherwise
+struct sgr_op {
+	struct sgr r;
+	bool reset;
+	bool lead_reset; // the parameters start with a reset
+};
+
+static void sgr_compile(struct sgr_op *op, const char *p, size_t n) {
+	op->r = (struct sgr) { .valid = true };
+	op->reset = sgr_apply(&op->r, p, n);
+	size_t z = 0;
+	while (z < n && p[z] == '0') z++;
+	op->lead_reset = z == n || p[z] == ';';
+}
+
+static void sgr_step(struct sgr *s, const struct sgr_op *op) {
+	const struct sgr *r = &op->r;
+	if (op->reset || !r->valid) {
+		*s = *r;
+		return;
+	}
+	s->attrs = (s->attrs & ~r->known) | r->attrs;
+	if (r->known & SGR_FG) s->fg = r->fg;
+	if (r->known & SGR_BG) s->bg = r->bg;
+	s->known |= r->known;
+}
+
+
+
+// pre-rendered pieces of the long format, split into SGR sequences and the
+// text following each when they are built
+struct fmt_seg {
+	unsigned char esc, esc_len; // parameters of the sequence, esc 0 if none
+	unsigned char text, text_len;
+	struct sgr_op op;
+};
+
+struct fmt_str {
+	unsigned char len, nsegs;
+	char s[46];
+	struct fmt_seg segs[4];
+};
+
+static struct fmt_seg *fs_seg(struct fmt_str *f) {
+	assertx(f->nsegs < sizeof(f->segs) / sizeof(*f->segs));
+	struct fmt_seg *g = &f->segs[f->nsegs++];
+	*g = (struct fmt_seg) { .text = f->len };
+	return g;
+}
+
+// append text that is not interpreted
+static void fs_text(struct fmt_str *f, const char *s, size_t n) {
+	assertx(f->len + n <= sizeof(f->s));
+	struct fmt_seg *g = f->nsegs ? &f->segs[f->nsegs - 1] : fs_seg(f);
+	memcpy(f->s + f->len, s, n);
+	f->len += n;
+	g->text_len += n;
+}
+
+// append text with SGR sequences in it
+static void fs_cat(struct fmt_str *f, const char *s, size_t n) {
+	for (size_t i = 0; i < n;) {
+		size_t q = i + 2;
+		if (s[i] == '\033' && i + 1 < n && s[i + 1] == '[') {
+			while (q < n && (ls_isdigit(s[q]) || s[q] == ';')) q++;
+			if (q < n && s[q] == 'm') {
+				assertx(f->len + q + 1 - i <= sizeof(f->s));
+				memcpy(f->s + f->len, s + i, q + 1 - i);
+				f->len += q + 1 - i;
+				struct fmt_seg *g = fs_seg(f);
+				g->esc = g->text - (q - i - 1);
+				g->esc_len = q - i - 2;
+				sgr_compile(&g->op, f->s + g->esc, g->esc_len);
+				i = q + 1;
+				continue;
+			}
+		}
+		size_t t = i + 1;
+		while (t < n && s[t] != '\033') t++;
+		fs_text(f, s + i, t - i);
+		i = t;
+	}
+}
+
+#define fs_puts(f, s) fs_cat(f, s, strlen(s))
+
+// name filters, matched against d_name before anything is stat'ed
+// "*.ext" patterns go into a sorted suffix table, the rest to fnmatch
+struct name_filter {
+	char **exts, **globs;
+	size_t exts_len, globs_len;
+};
+
+// absolute times only have minute resolution, so entries sharing a minute
+// share one localtime_r/strftime call
+struct abstime {
+	time_t minute;
+	bool recent;
+	struct fmt_str s;
+};
+
+#define ABSTIMES 256
+
+// file info vector
+typedef struct lsc_list {
+	file_info *data;
+	size_t cap, len;
+	int nwidth, uwidth, gwidth;
+	bool userinfo;
+	id_t uid, gid;
+	// bytes held by names, and sorted runs spilled past opts.mem_limit
+	size_t names, spilled, nruns;
+	struct spilled { FILE *f; unsigned level; } *runs;
+	bool failed; // a run could not be written or read back
+	// sorted, with user/group widths
+	bool prepared;
+	struct lsc *lsc;
+	struct lsc_options opts;
+	int at; // relative paths are resolved against this directory
+	// stat calls run on a worker when there are deadlines
+	struct stat_worker *worker;
+	unsigned abandoned; // workers left behind past a deadline
+	struct timespec deadline; // for the whole list, tv_sec 0 for none
+	struct name_filter include, exclude;
+	bool filter;
+	time_t now;
+	struct abstime abstimes[ABSTIMES];
+} file_list;
+
+static void lsc_warn(file_list *l, const char *fmt, ...) {
+	char msg[512];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if (l->opts.warn) (l->opts.warn)(l->opts.warn_ctx, msg);
+	else log("%s: %s", program_name, msg);
+}
+
+#define lsc_warn_errno(l, fmt, ...) \
+	lsc_warn(l, fmt ": %s", __VA_ARGS__, strerror(errno))
+
+static int fi_cmp(const file_list *l, const file_info *a, const file_info *b) {
+	int rev = l->opts.reverse ? -1 : 1;
+	if (!l->opts.no_group_dir)
+		if (fi_isdir(a) != fi_isdir(b))
+			return fi_isdir(a) ? -1 : 1;
+	if (l->opts.sort == LSC_SORT_SIZE) {
+		off_t s = a->size - b->size;
+		if (s) return rev * ((s > 0) - (s < 0));
+	}
+	if (l->opts.sort == LSC_SORT_TIME) {
+		time_t t = a->time - b->time;
+		if (t) return rev * ((t > 0) - (t < 0));
+	}
+	return rev * filevercmp(a->name, a->name_len, a->name_suf,
+		b->name, b->name_len, b->name_suf);
+}
+
+// merge sort, qsort has no way to pass the list options to fi_cmp
+static void fi_sort(const file_list *l, file_info *a, file_info *tmp, size_t n) {
+	if (n < 16) {
+		for (size_t i = 1; i < n; i++) {
+			file_info x = a[i];
+			size_t j = i;
+			for (; j && fi_cmp(l, &x, &a[j - 1]) < 0; j--)
+				a[j] = a[j - 1];
+			a[j] = x;
+		}
+		return;
+	}
+	size_t h = n / 2, i = 0, j = h, k = 0;
+	fi_sort(l, a, tmp, h);
+	fi_sort(l, a + h, tmp, n - h);
+	if (fi_cmp(l, &a[h - 1], &a[h]) <= 0) return;
+	memcpy(tmp, a, h * sizeof(*a));
+	while (i < h && j < n)
+		a[k++] = fi_cmp(l, &a[j], &tmp[i]) < 0 ? a[j++] : tmp[i++];
+	while (i < h)
+		a[k++] = tmp[i++];
+}
+
+static void fv_sort(file_list *v) {
+	if (v->len < 2) return;
+	file_info *tmp = xmalloc(v->len / 2, sizeof(*tmp));
+	fi_sort(v, v->data, tmp, v->len);
+	free(tmp);
+}
+
+static file_info *fv_index(file_list *v, size_t i) { return &v->data[i]; }
+
+static void fv_clear(file_list *v) {
+	v->nwidth = v->uwidth = v->gwidth = 0;
+	v->userinfo = v->opts.userinfo == LSC_UINFO_ALWAYS;
+	for (size_t i = 0; i < v->len; i++)
+		fi_free(fv_index(v, i));
+	v->len = 0;
+	for (size_t i = 0; i < v->nruns; i++)
+		fclose(v->runs[i].f);
+	v->names = v->spilled = v->nruns = 0;
+	v->prepared = false;
+	v->failed = false;
+}
+
+static void fv_init(file_list *v, size_t init) {
+	v->data = xmalloc(init, sizeof(file_info));
+	v->cap = init;
+	fv_clear(v);
+}
+
+static file_info *fv_stage(file_list *v) {
+	if (v->len >= v->cap) {
+		v->cap = size_mul(v->cap, 2);
+		v->data = xrealloc(v->data, v->cap, sizeof(file_info));
+	}
+	return fv_index(v, v->len);
+}
+
+static void fv_commit(file_list *v) {
+	file_info *fi = fv_index(v, v->len++);
+	v->names += fi->name_len + 1;
+	if (fi->linkname) v->names += fi->linkname_len + 1;
+	v->prepared = false;
+}
+
+// memory used by the list, counting the next doubling of data
+static size_t fv_mem(file_list *v) {
+	size_t cap = v->len < v->cap ? v->cap : v->cap * 2;
+	return cap * sizeof(file_info) + v->names;
+}
+
+static void fv_userwidths(file_list *v);
+static int fmt_name_width(const file_list *l, const file_info *fi);
+
+// spilled file_info, followed by the name and linkname bytes
+struct fi_record {
+	mode_t mode, linkmode;
+	id_t uid, gid;
+	time_t time;
+	off_t size;
+	int name_len, linkname_len, name_suf, uwidth, gwidth, nwidth;
+	bool linkok, link, timeout;
+};
+
+static FILE *spill_open(file_list *v) {
+	const char *dir = getenv("TMPDIR");
+	if (!dir || !*dir) dir = "/tmp";
+	size_t len = strlen(dir) + sizeof("/lsc.XXXXXX");
+	char *path = xmalloc(len, 1);
+	snprintf(path, len, "%s/lsc.XXXXXX", dir);
+	int fd = mkstemp(path);
+	if (fd != -1) unlink(path);
+	free(path);
+	FILE *f = fd == -1 ? 0 : fdopen(fd, "w+");
+	if (!f) {
+		lsc_warn_errno(v, "cannot create temporary file in '%s'", dir);
+		if (fd != -1) close(fd);
+		v->failed = true;
+	}
+	return f;
+}
+
+static void run_write(FILE *f, const file_info *fi, int nwidth) {
+	struct fi_record r = {
+		.mode = fi->mode, .linkmode = fi->linkmode,
+		.uid = fi->uid, .gid = fi->gid,
+		.time = fi->time, .size = fi->size,
+		.name_len = fi->name_len, .linkname_len = fi->linkname_len,
+		.name_suf = fi->name_suf,
+		.uwidth = fi->uwidth, .gwidth = fi->gwidth, .nwidth = nwidth,
+		.linkok = fi->linkok, .link = !!fi->linkname,
+		.timeout = fi->timeout,
+	};
+	fwrite(&r, sizeof(r), 1, f);
+	fwrite(fi->name, 1, fi->name_len, f);
+	if (fi->linkname) fwrite(fi->linkname, 1, fi->linkname_len, f);
+}
+
+static bool run_flush(file_list *v, FILE *f) {
+	if (fflush(f) != EOF && !ferror(f))
+		return true;
+	lsc_warn_errno(v, "%s", "cannot write temporary file");
+	fclose(f);
+	v->failed = true;
+	return false;
+}
+
+static int fv_compact(file_list *v);
+
+// sort the list and move it to a new run on disk; if that fails the list
+// stays in memory, the memory limit is given up on and -1 returned
+static int fv_spill(file_list *v) {
+	fv_sort(v);
+	if (v->opts.userinfo != LSC_UINFO_NEVER)
+		fv_userwidths(v);
+	FILE *f = spill_open(v);
+	if (!f) {
+		v->opts.mem_limit = 0;
+		return -1;
+	}
+	for (size_t i = 0; i < v->len; i++) {
+		file_info *fi = fv_index(v, i);
+		run_write(f, fi, fmt_name_width(v, fi));
+	}
+	if (!run_flush(v, f)) {
+		v->opts.mem_limit = 0;
+		return -1;
+	}
+	for (size_t i = 0; i < v->len; i++)
+		fi_free(fv_index(v, i));
+	v->runs = xrealloc(v->runs, v->nruns + 1, sizeof(*v->runs));
+	v->runs[v->nruns++] = (struct spilled) { f, 0 };
+	v->spilled += v->len;
+	v->len = 0;
+	v->names = 0;
+	return fv_compact(v);
+}
+
+// read the next record of a run, false at the end of it
+static bool run_read(file_list *v, FILE *f, file_info *fi) {
+	struct fi_record r;
+	if (fread(&r, sizeof(r), 1, f) != 1)
+		goto err;
+	*fi = (file_info) {
+		.mode = r.mode, .linkmode = r.linkmode,
+		.uid = r.uid, .gid = r.gid,
+		.time = r.time, .size = r.size,
+		.name_len = r.name_len, .linkname_len = r.linkname_len,
+		.name_suf = r.name_suf,
+		.uwidth = r.uwidth, .gwidth = r.gwidth, .nwidth = r.nwidth,
+		.linkok = r.linkok, .timeout = r.timeout,
+	};
+	char *name = xmalloc(r.name_len + 1, 1), *link = 0;
+	name[r.name_len] = '\0';
+	fi->name = name;
+	if (fread(name, 1, r.name_len, f) != (size_t)r.name_len)
+		goto err_free;
+	if (r.link) {
+		link = xmalloc(r.linkname_len + 1, 1);
+		link[r.linkname_len] = '\0';
+		fi->linkname = link;
+		if (fread(link, 1, r.linkname_len, f) != (size_t)r.linkname_len)
+			goto err_free;
+	}
+	return true;
+err_free:
+	fi_free(fi);
+err:
+	if (!feof(f) || ferror(f)) {
+		lsc_warn_errno(v, "%s", "cannot read temporary file");
+		v->failed = true;
+	}
+	return false;
+}
+
+// read symlink target; size is only a hint, as it is 0 for /proc links and
+// the link may be replaced between lstat and readlink
+static const char *ls_readlink(int dirfd, const char *name, size_t size,
+	size_t *len)
+{
+	char *buf = 0;
+	for (size_t cap = MAX(size, 64) + 1; cap <= 1 << 20; cap *= 2) {
+		buf = xrealloc(buf, cap, 1);
+		ssize_t n = readlinkat(dirfd, name, buf, cap);
+		if (n == -1)
+			break;
+		if ((size_t)n < cap) { // not truncated
+			buf[n] = '\0';
+			*len = n;
+			return buf;
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+// populates the metadata of file_info with information on path, relative
+// to dirfd; this does not touch the list, so it can run on a worker
+static int stat_entry(file_info *fi, int dirfd, const char *path, bool m_time) {
+	fi->linkname = 0;
+	fi->linkname_len = 0;
+	fi->linkmode = 0;
+	fi->linkok = true;
+	fi->timeout = false;
+	struct stat st;
+	if (fstatat(dirfd, path, &st, AT_SYMLINK_NOFOLLOW) == -1)
+		return -1;
+	fi->mode = st.st_mode;
+	fi->time = m_time ? st.st_mtime : st.st_ctime;
+	fi->size = st.st_size;
+	fi->uid = st.st_uid;
+	fi->gid = st.st_gid;
+	if (S_ISLNK(fi->mode)) {
+		size_t len;
+		const char *ln = ls_readlink(dirfd, path, st.st_size, &len);
+		if (!ln) { fi->linkok = false; return 0; }
+		fi->linkname = ln;
+		fi->linkname_len = len;
+		if (fstatat(dirfd, path, &st, 0) == -1) {
+			fi->linkok = false;
+			return 0;
+		}
+		fi->linkmode = st.st_mode;
+	}
+	return 0;
+}
+
+// thread running stat_entry, so that a hung mount only stalls it; one that
+// misses its deadline is abandoned and frees itself once the call returns
+struct stat_worker {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int refs; // held by the list and by the thread
+	bool busy, done, quit;
+	// job, owned by the worker: a copy of the directory fd and the path
+	int dirfd;
+	char *path;
+	bool m_time;
+	// result
+	file_info fi;
+	int rc, err;
+};
+
+// workers a list may abandon past a deadline, possibly stuck in stat_entry
+// for good; after that its entries time out right away
+#define SW_ABANDONED_MAX 64
+
+// drop a reference, with the lock held
+static void sw_unref(struct stat_worker *w) {
+	bool last = !--w->refs;
+	pthread_mutex_unlock(&w->lock);
+	if (!last) return;
+	if (w->done) free((void *)w->fi.linkname);
+	if (w->dirfd >= 0) close(w->dirfd);
+	free(w->path);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+static void *sw_run(void *p) {
+	struct stat_worker *w = p;
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->busy && !w->quit)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (!w->busy) break;
+		pthread_mutex_unlock(&w->lock);
+		file_info fi;
+		int rc = stat_entry(&fi, w->dirfd, w->path, w->m_time), err = errno;
+		pthread_mutex_lock(&w->lock);
+		w->fi = fi, w->rc = rc, w->err = err;
+		w->busy = false, w->done = true;
+		pthread_cond_broadcast(&w->cond);
+	}
+	sw_unref(w);
+	return 0;
+}
+
+static struct stat_worker *sw_new(void) {
+	struct stat_worker *w = calloc(1, sizeof(*w));
+	assertx(w);
+	pthread_condattr_t ca;
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&w->cond, &ca);
+	pthread_condattr_destroy(&ca);
+	pthread_mutex_init(&w->lock, 0);
+	w->refs = 2;
+	w->dirfd = -1;
+	pthread_t t;
+	if (pthread_create(&t, 0, sw_run, w)) {
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return 0;
+	}
+	pthread_detach(t);
+	return w;
+}
+
+// let the worker go, it is freed by whoever drops the last reference
+static void sw_release(file_list *l) {
+	struct stat_worker *w = l->worker;
+	if (!w) return;
+	l->worker = 0;
+	pthread_mutex_lock(&w->lock);
+	w->quit = true;
+	pthread_cond_broadcast(&w->cond);
+	sw_unref(w);
+}
+
+static void ts_add_ms(struct timespec *t, unsigned ms) {
+	t->tv_sec += ms / 1000;
+	t->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (t->tv_nsec >= 1000000000) t->tv_sec++, t->tv_nsec -= 1000000000;
+}
+
+static bool ts_before(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// stat_entry on the worker, marking fi as timed out past the deadlines, or
+// right away when no worker can be had, as the calling thread must not block
+static int stat_deadline(file_list *l, file_info *fi, int dirfd,
+	const char *path)
+{
+	struct timespec dl, now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	bool total = l->deadline.tv_sec;
+	if (total && !ts_before(&now, &l->deadline))
+		goto timeout;
+	dl = now;
+	ts_add_ms(&dl, l->opts.stat_timeout);
+	if (total && (!l->opts.stat_timeout || ts_before(&l->deadline, &dl)))
+		dl = l->deadline;
+	if (!l->worker && (l->abandoned >= SW_ABANDONED_MAX ||
+	    !(l->worker = sw_new())))
+		goto timeout;
+	struct stat_worker *w = l->worker;
+	int fd = dirfd;
+	if (dirfd != AT_FDCWD && (fd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0)) == -1)
+		return -1;
+	pthread_mutex_lock(&w->lock);
+	if (w->dirfd >= 0) close(w->dirfd);
+	free(w->path);
+	w->dirfd = fd;
+	w->path = strdup(path);
+	w->m_time = l->opts.m_time;
+	w->busy = true;
+	pthread_cond_broadcast(&w->cond);
+	int e = 0;
+	while (!w->done && e != ETIMEDOUT)
+		e = pthread_cond_timedwait(&w->cond, &w->lock, &dl);
+	if (!w->done) {
+		w->quit = true;
+		l->abandoned++;
+		l->worker = 0;
+		sw_unref(w);
+		goto timeout;
+	}
+	const char *name = fi->name;
+	int name_len = fi->name_len, name_suf = fi->name_suf;
+	*fi = w->fi;
+	fi->name = name, fi->name_len = name_len, fi->name_suf = name_suf;
+	w->done = false;
+	int rc = w->rc;
+	errno = w->err;
+	pthread_mutex_unlock(&w->lock);
+	return rc;
+timeout:
+	fi->mode = fi->linkmode = 0;
+	fi->uid = fi->gid = 0;
+	fi->time = 0;
+	fi->size = 0;
+	fi->linkname = 0;
+	fi->linkname_len = 0;
+	fi->linkok = false;
+	fi->timeout = true;
+	return 0;
+}
+
+// populates file_info with information on path, relative to dirfd
+static int ls_stat(file_list *l, file_info *fi, int dirfd, const char *path,
+	char *name)
+{
+	fi->name = name;
+	fi->name_len = strlen(name);
+	fi->name_suf = suf_index(name, fi->name_len);
+	int rc = l->opts.stat_timeout || l->opts.total_timeout ?
+		stat_deadline(l, fi, dirfd, path) :
+		stat_entry(fi, dirfd, path, l->opts.m_time);
+	if (!rc && !fi->timeout && l->opts.userinfo == LSC_UINFO_AUTO)
+		l->userinfo |= fi->uid != l->uid || fi->gid != l->gid;
+	return rc;
+}
+
+static int nf_cmp(const void *va, const void *vb) {
+	return strcmp(*(const char *const *)va, *(const char *const *)vb);
+}
+
+static void nf_add(struct name_filter *f, const char *pat) {
+	const char *ext = pat + 1;
+	if (pat[0] == '*' && ext[0] == '.' && !ext[strcspn(ext, "*?[\\")]) {
+		f->exts = xrealloc(f->exts, f->exts_len + 1, sizeof(*f->exts));
+		f->exts[f->exts_len++] = strdup(ext);
+	} else {
+		f->globs = xrealloc(f->globs, f->globs_len + 1, sizeof(*f->globs));
+		f->globs[f->globs_len++] = strdup(pat);
+	}
+}
+
+static void nf_compile(struct name_filter *f) {
+	if (f->exts_len) qsort(f->exts, f->exts_len, sizeof(*f->exts), nf_cmp);
+}
+
+static void nf_free(struct name_filter *f) {
+	for (size_t i = 0; i < f->exts_len; i++) free(f->exts[i]);
+	for (size_t i = 0; i < f->globs_len; i++) free(f->globs[i]);
+	free(f->exts);
+	free(f->globs);
+}
+
+static bool nf_match(const struct name_filter *f, const char *name) {
+	if (f->exts_len)
+		for (const char *p = name; (p = strchr(p, '.')); p++)
+			if (bsearch(&p, f->exts, f->exts_len, sizeof(*f->exts), nf_cmp))
+				return true;
+	for (size_t i = 0; i < f->globs_len; i++)
+		if (!fnmatch(f->globs[i], name, 0))
+			return true;
+	return false;
+}
+
+static bool name_selected(file_list *l, const char *name) {
+	if (l->include.exts_len + l->include.globs_len &&
+	    !nf_match(&l->include, name))
+		return false;
+	return !nf_match(&l->exclude, name);
+}
+
+// stat a directory entry into the list
+static int ls_add(file_list *v, int fd, const char *dir, const char *p,
+	char *dup)
+{
+	file_info *out = fv_stage(v);
+	if (ls_stat(v, out, fd, p, dup) == -1) {
+		free(dup);
+		lsc_warn_errno(v, "cannot access '%s/%s'", dir, p);
+		return -1;
+	}
+	int err = 0;
+	if (out->timeout) {
+		lsc_warn(v, "timed out accessing '%s/%s'", dir, p);
+		err = -1;
+	}
+	fv_commit(v);
+	if (v->opts.mem_limit && fv_mem(v) > v->opts.mem_limit)
+		err |= fv_spill(v);
+	return err;
+}
+
+// directory entry waiting to be stat'ed
+struct ino_entry { ino_t ino; char *name; };
+
+static int ino_cmp(const void *va, const void *vb) {
+	const struct ino_entry *a = va, *b = vb;
+	return (a->ino > b->ino) - (a->ino < b->ino);
+}
+
+// stat a batch of entries in inode order, which on cold caches walks the
+// inode table in one direction instead of seeking for every entry
+static int ls_add_batch(file_list *v, int fd, const char *dir,
+	struct ino_entry *batch, size_t n)
+{
+	int err = 0;
+	qsort(batch, n, sizeof(*batch), ino_cmp);
+	for (size_t i = 0; i < n; i++)
+		err |= ls_add(v, fd, dir, batch[i].name, batch[i].name);
+	return err;
+}
+
+// list directory
+static int ls_readdir(file_list *v, const char *name) {
+	int dfd = openat(v->at, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dir = dfd == -1 ? 0 : fdopendir(dfd);
+	if (!dir) {
+		lsc_warn_errno(v, "cannot open directory '%s'", name);
+		if (dfd != -1) close(dfd);
+		return -1;
+	}
+	int fd = dirfd(dir);
+	if (fd == -1) {
+		lsc_warn_errno(v, "%s", name);
+		return -1;
+	}
+	struct dirent *dent;
+	int err = 0;
+	struct ino_entry *batch = 0;
+	size_t len = 0, cap = 0, bytes = 0;
+	while ((dent = readdir(dir))) {
+		const char *p = dent->d_name;
+		if (p[0] == '.' && !v->opts.all) continue;
+		if (p[0] == '.' && p[1] == '\0') continue;
+		if (p[0] == '.' && p[1] == '.' && p[2] == '\0') continue;
+		if (v->filter && !name_selected(v, p)) continue;
+		if (!v->opts.inode_order) {
+			err |= ls_add(v, fd, name, p, strdup(p));
+			continue;
+		}
+		if (len == cap)
+			batch = xrealloc(batch, cap = cap ? size_mul(cap, 2) : 256,
+				sizeof(*batch));
+		batch[len++] = (struct ino_entry) { dent->d_ino, strdup(p) };
+		bytes += sizeof(*batch) + strlen(p) + 1;
+		if (v->opts.mem_limit && bytes > v->opts.mem_limit) {
+			err |= ls_add_batch(v, fd, name, batch, len);
+			len = bytes = 0;
+		}
+	}
+	if (len)
+		err |= ls_add_batch(v, fd, name, batch, len);
+	free(batch);
+	if (closedir(dir) == -1)
+		return -1;
+	return err;
+}
+
+// command line argument, split into parent directory and base name
+struct arg { const char *path, *base; size_t dirlen; int i; };
+
+static int arg_cmp(const void *va, const void *vb) {
+	const struct arg *a = va, *b = vb;
+	if (a->dirlen != b->dirlen) return a->dirlen < b->dirlen ? -1 : 1;
+	return memcmp(a->path, b->path, a->dirlen);
+}
+
+// list files given as arguments; non-directories are stat'ed relative to
+// their parent directory, which is opened once for all of its arguments,
+// directories to be read are stored at their index in dirs; with deadlines
+// the full paths are stat'ed, as opening the parent could block as well
+static int ls_args(file_list *v, char *const *paths, int n, const char **dirs) {
+	bool deadline = v->opts.stat_timeout || v->opts.total_timeout;
+	struct arg *args = xmalloc(n, sizeof(*args));
+	for (int i = 0; i < n; i++) {
+		const char *p = paths[i], *s = strrchr(p, '/');
+		args[i] = (struct arg) { .path = p, .base = p, .i = i };
+		if (s && s[1]) {
+			args[i].base = s + 1;
+			args[i].dirlen = s == p ? 1 : (size_t)(s - p);
+		}
+		dirs[i] = 0;
+	}
+	qsort(args, n, sizeof(*args), arg_cmp);
+	int err = 0, fd = v->at;
+	for (int i = 0; i < n; i++) {
+		struct arg *a = &args[i];
+		if (!i || arg_cmp(a, a - 1)) {
+			if (fd != v->at) close(fd);
+			fd = v->at;
+			if (a->dirlen && !deadline) { // else use the full paths
+				char *dir = strndup(a->path, a->dirlen);
+				fd = openat(v->at, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+				if (fd == -1) fd = v->at;
+				free(dir);
+			}
+		}
+		file_info *out = fv_stage(v); // new uninitialized file_info
+		char *dup = strdup(a->path);
+		if (ls_stat(v, out, fd, fd == v->at ? a->path : a->base, dup) == -1) {
+			free(dup);
+			err = -1;
+			lsc_warn_errno(v, "cannot access '%s'", a->path);
+			continue;
+		}
+		if (!v->opts.dir && fi_isdir(out)) {
+			fi_free(out);
+			dirs[a->i] = a->path;
+			continue;
+		}
+		if (out->timeout) {
+			lsc_warn(v, "timed out accessing '%s'", a->path);
+			err = -1;
+		}
+		fv_commit(v);
+	}
+	if (fd != v->at) close(fd);
+	free(args);
+	return err;
+}
+
+enum ls_color_labels {
+	L_LEFT, L_RIGHT, L_END, L_RESET, L_NORM, L_FILE, L_DIR, L_LINK, L_FIFO,
+	L_SOCK, L_BLK, L_CHR, L_MISSING, L_ORPHAN, L_EXEC, L_DOOR, L_SETUID,
+	L_SETGID, L_STICKY, L_OW, L_STICKYOW, L_CAP, L_MULTIHARDLINK, L_CLR_TO_EOL,
+	L_LENGTH,
+};
+
+// an LS_COLORS value, with what it does worked out when parsing
+struct lsc_color {
+	const char *s; // NULL if not set
+	size_t len;
+	struct sgr_op op;
+};
+
+struct lsc_pair {
+	const char *ext;
+	struct lsc_color color;
+};
+
+struct ls_colors {
+	struct lsc_color labels[L_LENGTH];
+	struct lsc_pair *map;
+	size_t exts;
+};
+
+static const char *const lsc_labels[] = {
+	"lc", "rc", "ec", "rs", "no", "fi", "di", "ln",
+	"pi", "so", "bd", "cd", "mi", "or", "ex", "do",
+	"su", "sg", "st", "ow", "tw", "ca", "mh", "cl", NULL,
+};
+
+static int lsc_cmp(const void *va, const void *vb) {
+	struct lsc_pair *a = (struct lsc_pair *const)va;
+	struct lsc_pair *b = (struct lsc_pair *const)vb;
+	return strcmp(a->ext, b->ext);
+}
+
+static const struct lsc_color *lsc_lookup(const struct ls_colors *lc,
+	const char *ext)
+{
+	struct lsc_pair k = { .ext = ext }, *res;
+	res = bsearch(&k, lc->map, lc->exts, sizeof(k), lsc_cmp);
+	return res ? &res->color : NULL;
+}
+
+static struct lsc_color lsc_color(const char *s) {
+	struct lsc_color c = { .s = s, .len = strlen(s) };
+	sgr_compile(&c.op, c.s, c.len);
+	return c;
+}
+
+static void lsc_parse(struct ls_colors *lc, char *lsc_env) {
+	size_t exts = 0, exti = 0;
+	size_t len = strlen(lsc_env);
+	for (size_t i = 0; i < len; i++) if (lsc_env[i] == '*') exts++;
+	lc->map = xmalloc(exts, sizeof(*lc->map));
+	bool eq = false;
+	size_t kbegin = 0, kend = 0;
+	for (size_t i = 0; i < len; i++) {
+		char c = lsc_env[i];
+		if (c == '=') { kend = i; eq = true; continue; }
+		if (!eq || c != ':') continue;
+		lsc_env[kend] = lsc_env[i] = '\0';
+		char *k = lsc_env + kbegin;
+		char *v = lsc_env + kend + 1;
+		if (*k == '*')
+			lc->map[exti++] = (struct lsc_pair) { k + 1, lsc_color(v) };
+		else if (kend - kbegin == 2)
+			for (size_t i = 0; i < L_LENGTH; i++)
+				if (k[0] == lsc_labels[i][0] && k[1] == lsc_labels[i][1]) {
+					lc->labels[i] = lsc_color(v);
+					break;
+				}
+		kbegin = i + 1;
+		i += 2;
+		eq = false;
+	}
+	lc->exts = exti;
+	qsort(lc->map, lc->exts, sizeof(*lc->map), lsc_cmp);
+}
+
+struct idcache { struct idcache *next; id_t id; char name[]; };
+
+
+static void id_free(struct idcache *p) {
+	while (p) {
+		struct idcache *next = p->next;
+		free(p);
+		p = next;
+	}
+}
+
+#define SECOND 1
+#define MINUTE (60 * SECOND)
+#define HOUR   (60 * MINUTE)
+#define DAY    (24 * HOUR)
+#define WEEK   (7  * DAY)
+#define MONTH  (30 * DAY)
+#define YEAR   (12 * MONTH)
+
+// relative time units, the last one catches everything older
+static const struct {
+	time_t limit, unit;
+	const char *color;
+	char suffix;
+} reltimes[] = {
+	{ MINUTE,  SECOND, C_SECOND, 's' },
+	{ HOUR,    MINUTE, C_MINUTE, 'm' },
+	{ HOUR*36, HOUR,   C_HOUR,   'h' },
+	{ MONTH,   DAY,    C_DAY,    'd' },
+	{ YEAR,    WEEK,   C_WEEK,   'w' },
+	{ 0,       YEAR,   C_YEAR,   'y' },
+};
+
+#define RELTIMES (sizeof(reltimes) / sizeof(*reltimes))
+
+// state shared by all lists
+struct lsc {
+	char *env; // LS_COLORS, parsed in place
+	struct ls_colors colors;
+	pthread_mutex_t lock; // held for the id caches
+	struct idcache *ucache, *gcache;
+	unsigned cpus; // online at lsc_new, bounds the rendering threads
+	// file type, indexed by the S_IFMT bits
+	struct fmt_str strmode_type[16];
+	// rwx triads, indexed by r<<3|w<<2|x<<1|special (suid, sgid, sticky)
+	struct fmt_str strmode_perm[3][16];
+	// rendered relative times for values below 100 in each unit
+	struct fmt_str reltime_strs[RELTIMES][100];
+	// "%3d" and "%d.%d" renderings of the number part of sizes
+	char size_int[1000][3], size_dec[100][3];
+	// the other config.h sequences, split once
+	struct fmt_str end, sym_delim, userinfo, size, day;
+	struct fmt_str reltime_now, reltime_future, reltime_color[RELTIMES];
+	struct fmt_str cl_exec, cl_dir, cl_link, cl_fifo, cl_sock, cl_timeout;
+	struct fmt_str unknown_mode, unknown_abstime, unknown_reltime,
+		unknown_size;
+	struct lsc_color reset; // for files without a colour
+};
+
+// the caches are shared between threads under c->lock, entries live as long
+// as the lsc; the NSS calls (getpwuid_r, getgrgid_r) on a miss run unlocked,
+// so a racing thread may add a duplicate entry
+static struct idcache *id_get(struct lsc *c, struct idcache **cache, id_t id) {
+	pthread_mutex_lock(&c->lock);
+	struct idcache *p = *cache;
+	while (p && p->id != id) p = p->next;
+	pthread_mutex_unlock(&c->lock);
+	return p;
+}
+
+static const char *id_put(struct lsc *c, struct idcache **cache, id_t id,
+	const char *name)
+{
+	struct idcache *p = xmalloc(sizeof(*p) + strlen(name) + 1, 1);
+	strcpy(p->name, name);
+	p->id = id;
+	pthread_mutex_lock(&c->lock);
+	p->next = *cache, *cache = p;
+	pthread_mutex_unlock(&c->lock);
+	return p->name[0] ? p->name : 0;
+}
+
+static const char *getuser(struct lsc *c, uid_t id) {
+	struct idcache *p = id_get(c, &c->ucache, id);
+	if (p) return p->name[0] ? p->name : 0;
+	struct passwd pw, *e = 0;
+	char *buf = 0;
+	size_t size = 512;
+	do buf = xrealloc(buf, size *= 2, 1);
+	while (getpwuid_r(id, &pw, buf, size, &e) == ERANGE);
+	const char *name = id_put(c, &c->ucache, id, e ? e->pw_name : "");
+	free(buf);
+	return name;
+}
+
+static const char *getgroup(struct lsc *c, gid_t id) {
+	struct idcache *p = id_get(c, &c->gcache, id);
+	if (p) return p->name[0] ? p->name : 0;
+	struct group gr, *e = 0;
+	char *buf = 0;
+	size_t size = 512;
+	do buf = xrealloc(buf, size *= 2, 1);
+	while (getgrgid_r(id, &gr, buf, size, &e) == ERANGE);
+	const char *name = id_put(c, &c->gcache, id, e ? e->gr_name : "");
+	free(buf);
+	return name;
+}
+
+// output stream that tracks the SGR state and only emits transitions,
+// every line starts from scratch so lines can be rendered independently
+struct out {
+	FILE *f;              // written in OUT_BUF blocks, or a growing buffer if NULL
+	char *buf;
+	size_t cap, len;
+	bool coalesce;
+	struct abstime *abstimes; // private fmt_abstime cache, else the list's
+	struct sgr cur, pend; // state on the terminal, and after pending params
+	char params[64];      // pending parameters when coalescing
+	size_t plen;
+};
+
+#define OUT_INIT(file, c) \
+	{ .f = (file), .coalesce = (c), .cur.valid = true, .pend.valid = true }
+
+#define OUT_BUF 8192
+
+static void out_drain(struct out *o) {
+	if (o->len) fwrite(o->buf, 1, o->len, o->f);
+	o->len = 0;
+}
+
+// escapes and fields are written in small pieces, so going through stdio
+// for each costs more than formatting them
+static void out_raw(struct out *o, const char *p, size_t n) {
+	if (o->f && o->len + n > OUT_BUF) {
+		out_drain(o);
+		if (n >= OUT_BUF) {
+			fwrite(p, 1, n, o->f);
+			return;
+		}
+	}
+	if (o->len + n > o->cap) {
+		o->cap = MAX(size_mul(o->cap, 2), o->len + n);
+		o->buf = xrealloc(o->buf, o->cap, 1);
+	}
+	memcpy(o->buf + o->len, p, n);
+	o->len += n;
+}
+
+static void out_esc(struct out *o, const char *p, size_t n) {
+	out_raw(o, C_ESC, sizeof(C_ESC) - 1);
+	out_raw(o, p, n);
+	out_raw(o, "m", 1);
+}
+
+static void out_flush_sgr(struct out *o) {
+	if (!o->plen) return;
+	if (!sgr_eq(&o->pend, &o->cur)) out_esc(o, o->params, o->plen);
+	o->cur = o->pend;
+	o->plen = 0;
+}
+
+// set graphics state; when coalescing, consecutive sequences are merged into one
+// and held back over spaces until visible text needs them
+static void out_sgr(struct out *o, const char *p, size_t n,
+	const struct sgr_op *op)
+{
+	struct sgr next = o->pend;
+	sgr_step(&next, op);
+	if (!o->coalesce) {
+		if (!sgr_eq(&next, &o->cur)) out_esc(o, p, n);
+		o->cur = o->pend = next;
+		return;
+	}
+	if (op->lead_reset) // drop what came before
+		o->plen = 0;
+	else if (o->plen && o->plen + 1 + n > sizeof(o->params))
+		out_flush_sgr(o);
+	if (o->plen + 1 + n > sizeof(o->params)) {
+		if (!sgr_eq(&next, &o->cur)) out_esc(o, p, n);
+		o->cur = o->pend = next;
+		return;
+	}
+	if (o->plen) o->params[o->plen++] = ';';
+	memcpy(o->params + o->plen, p, n);
+	o->plen += n;
+	o->pend = next;
+}
+
+// write text without escapes; pending SGR changes are held back over
+// spaces that look the same either way
+static void out_plain(struct out *o, const char *s, size_t n) {
+	if (o->plen) {
+		while (n && *s == ' ' && sgr_same(&o->cur, &o->pend, SGR_SPACE))
+			out_raw(o, s++, 1), n--;
+		if (!n) return;
+		out_flush_sgr(o);
+	}
+	out_raw(o, s, n);
+}
+
+static void out_putc(struct out *o, char c) {
+	if (c != '\n') {
+		out_plain(o, &c, 1);
+		return;
+	}
+	out_flush_sgr(o);
+	out_raw(o, "\n", 1);
+	o->cur = o->pend = (struct sgr) { .valid = true };
+}
+
+static void fs_write(const struct fmt_str *f, struct out *out) {
+	for (const struct fmt_seg *g = f->segs; g < f->segs + f->nsegs; g++) {
+		if (g->esc) out_sgr(out, f->s + g->esc, g->esc_len, &g->op);
+		if (g->text_len) out_plain(out, f->s + g->text, g->text_len);
+	}
+}
+
+// write text that is not interpreted, like file names
+static void out_text(struct out *o, const char *s, size_t n) {
+	if (!n) return;
+	out_flush_sgr(o);
+	out_raw(o, s, n);
+	if (memchr(s, '\033', n))
+		o->cur.valid = o->pend.valid = false;
+}
+
+// file type, indexed by the S_IFMT bits
+#define MODE_TYPE(m) (((m)&S_IFMT) >> 12)
+
+static void strmode_init(struct lsc *c) {
+	for (int t = 0; t < 16; t++) {
+		const char *s;
+		switch (t << 12) {
+		case S_IFREG:  s = C_FILE;    break;
+		case S_IFDIR:  s = C_DIR;     break;
+		case S_IFCHR:  s = C_CHAR;    break;
+		case S_IFBLK:  s = C_BLOCK;   break;
+		case S_IFIFO:  s = C_FIFO;    break;
+		case S_IFLNK:  s = C_LINK;    break;
+		case S_IFSOCK: s = C_SOCK;    break;
+		default:       s = C_UNKNOWN; break;
+		}
+		fs_puts(&c->strmode_type[t], s);
+	}
+	static const char *const special[3][2] = {
+		{ C_UID, C_UID_EXEC }, { C_UID, C_UID_EXEC }, { C_STICKY_O, C_STICKY },
+	};
+	for (int i = 0; i < 3; i++)
+		for (int b = 0; b < 16; b++) {
+			struct fmt_str *f = &c->strmode_perm[i][b];
+			fs_puts(f, b&8 ? C_READ : C_NONE);
+			fs_puts(f, b&4 ? C_WRITE : C_NONE);
+			fs_puts(f, b&1 ? special[i][!!(b&2)] : b&2 ? C_EXEC : C_NONE);
+		}
+}
+
+static void fmt_strmode(struct out *out, const struct lsc *c, const mode_t mode) {
+	fs_write(&c->strmode_type[MODE_TYPE(mode)], out);
+	fs_write(&c->strmode_perm[0][(mode>>6&7)<<1 | !!(mode&S_ISUID)], out);
+	fs_write(&c->strmode_perm[1][(mode>>3&7)<<1 | !!(mode&S_ISGID)], out);
+	fs_write(&c->strmode_perm[2][(mode&7)<<1 | !!(mode&S_ISVTX)], out);
+	out_putc(out, ' ');
+}
+
+static void fmt_abstime(struct out *out, file_list *l, const time_t then) {
+	bool recent = l->now - then < MONTH * 6;
+	time_t minute = then / MINUTE - (then % MINUTE < 0);
+	struct abstime *c = out->abstimes ? out->abstimes : l->abstimes;
+	size_t slot = (size_t)minute % ABSTIMES;
+	struct fmt_str *f = &c[slot].s;
+	if (f->len && c[slot].minute == minute && c[slot].recent == recent) {
+		fs_write(f, out);
+		return;
+	}
+	char buf[20];
+	struct tm tm;
+	localtime_r(&then, &tm);
+	char *fmt = recent ? "%e %b %H:%M" : "%e %b  %Y";
+	strftime(buf, sizeof(buf), fmt, &tm);
+	*f = l->lsc->day;
+	fs_text(f, buf, strlen(buf));
+	fs_text(f, " ", 1);
+	c[slot].minute = minute;
+	c[slot].recent = recent;
+	fs_write(f, out);
+}
+
+static void fmt3(char b[static 3], int x) {
+	if (x/100) b[0] = '0' + x/100;
+	if (x/100||x/10%10) b[1] = '0' + x/10%10;
+	b[2] = '0' + x%10;
+}
+
+static void reltime_render(struct fmt_str *f, const struct lsc *c, size_t u,
+	int x)
+{
+	char b[4] = "  0s";
+	b[3] = reltimes[u].suffix;
+	fmt3(b, x);
+	*f = c->reltime_color[u];
+	fs_text(f, b+1, 3);
+	fs_text(f, " ", 1);
+}
+
+static void fmt_reltime(struct out *out, const file_list *l, const time_t then) {
+	time_t diff = l->now - then;
+	if (diff < 0) {
+		fs_write(&l->lsc->reltime_future, out);
+		return;
+	}
+	if (diff <= SECOND) {
+		fs_write(&l->lsc->reltime_now, out);
+		return;
+	}
+	size_t u = 0;
+	while (u < RELTIMES - 1 && diff >= reltimes[u].limit) u++;
+	diff /= reltimes[u].unit;
+	if (diff < 100) {
+		fs_write(&l->lsc->reltime_strs[u][diff], out);
+		return;
+	}
+	struct fmt_str f;
+	reltime_render(&f, l->lsc, u, diff);
+	fs_write(&f, out);
+}
+
+static const char *const C_SIZES[7] = { "B", "K", "M", "G", "T", "P", "E" };
+
+static off_t divide(off_t x, off_t d) { return (x+(d-1)/2)/d; }
+
+// TODO: make this reusable
+static void fmt_size(struct out *out, const struct lsc *c, off_t sz) {
+	int m = 0;
+	off_t div = 1, u = sz;
+	while (u > 999) {
+		div *= 1024;
+		u = divide(u, 1024);
+		m++;
+	}
+	off_t v = divide(sz*10, div);
+	char b[5];
+	memcpy(b, v/10 >= 10 || m == 0 ? c->size_int[u] : c->size_dec[v], 3);
+	b[3] = C_SIZES[m][0];
+	b[4] = ' ';
+	fs_write(&c->size, out);
+	out_plain(out, b, sizeof(b));
+}
+
+static void fmt_init(struct lsc *c) {
+	strmode_init(c);
+	for (size_t u = 0; u < RELTIMES; u++) {
+		fs_puts(&c->reltime_color[u], reltimes[u].color);
+		for (int x = 0; x < 100; x++)
+			reltime_render(&c->reltime_strs[u][x], c, u, x);
+	}
+	fs_puts(&c->reltime_now, C_SECOND "<1s " C_END);
+	fs_puts(&c->reltime_future, C_SECOND " 0s " C_END);
+	fs_puts(&c->end, C_END);
+	fs_puts(&c->sym_delim, " " C_SYM_DELIM_COLOR C_SYM_DELIM);
+	fs_puts(&c->userinfo, C_USERINFO);
+	fs_puts(&c->size, C_SIZE);
+	fs_puts(&c->day, C_DAY);
+	fs_puts(&c->cl_exec, CL_EXEC);
+	fs_puts(&c->cl_dir, CL_DIR);
+	fs_puts(&c->cl_link, CL_LINK);
+	fs_puts(&c->cl_fifo, CL_FIFO);
+	fs_puts(&c->cl_sock, CL_SOCK);
+	fs_puts(&c->cl_timeout, CL_TIMEOUT);
+	fs_puts(&c->unknown_mode, C_UNKNOWN "????????? ");
+	fs_puts(&c->unknown_abstime, C_END "           ? ");
+	fs_puts(&c->unknown_reltime, C_END "  ? ");
+	fs_puts(&c->unknown_size, C_END "   ? ");
+	c->reset = lsc_color("0");
+	for (int x = 0; x < 1000; x++) {
+		memcpy(c->size_int[x], "  0", 3);
+		fmt3(c->size_int[x], x);
+	}
+	for (int x = 0; x < 100; x++) {
+		c->size_dec[x][0] = '0' + x/10;
+		c->size_dec[x][1] = '.';
+		c->size_dec[x][2] = '0' + x%10;
+	}
+}
+
+static int color_type(mode_t mode) {
+	#define S_IXUGO (S_IXUSR|S_IXGRP|S_IXOTH)
+	switch (mode&S_IFMT) {
+	case S_IFREG:
+		if (mode&S_ISUID) return L_SETUID;
+		if (mode&S_ISGID) return L_SETGID;
+		if (mode&S_IXUGO) return L_EXEC;
+		return L_FILE;
+	case S_IFDIR:
+		if (mode&S_ISVTX && mode&S_IWOTH) return L_STICKYOW;
+		if (mode&S_IWOTH) return L_OW;
+		if (mode&S_ISVTX) return L_STICKY;
+		return L_DIR;
+	case S_IFLNK: return L_LINK;
+	case S_IFIFO: return L_FIFO;
+	case S_IFSOCK: return L_SOCK;
+	case S_IFCHR: return L_CHR;
+	case S_IFBLK: return L_BLK;
+	default: return L_ORPHAN;
+	}
+}
+
+static const struct lsc_color *suf_color(const struct ls_colors *lc,
+	const char *name, size_t len)
+{
+	while (len--)
+		if (name[len] == '.')
+			return lsc_lookup(lc, name + len);
+	return 0;
+}
+
+static const struct lsc_color *file_color(const struct ls_colors *lc,
+	const char *name, size_t len, int t)
+{
+	if (t == L_FILE || t == L_LINK) {
+		const struct lsc_color *c = suf_color(lc, name, len);
+		if (c) return c;
+	}
+	return lc->labels[t].s ? &lc->labels[t] : NULL;
+}
+
+static int strwidth(const char *s) {
+	mbstate_t st = {0};
+	wchar_t wc;
+	int len = strlen(s), w = 0, i = 0;
+	while (i < len) {
+		int c = (unsigned char)s[i];
+		if (c <= 0x7f) { // ascii fast path
+			if (0x7f > c && c > 0x1f) { w++, i++; }
+			continue;
+		}
+		int r = mbrtowc(&wc, s+i, len-i, &st);
+		if (r < 0) break;
+		w += wcwidth(wc);
+		i += r;
+	}
+	return w;
+}
+
+static int fmt_name_width(const file_list *l, const file_info *fi) {
+	int w = strwidth(fi->name);
+	if (l->opts.follow_links && fi->linkname) {
+		w += 1 + strlen(C_SYM_DELIM) + strwidth(fi->linkname);
+	}
+	if (!l->opts.no_classify) {
+		mode_t m = fi->linkname && l->opts.follow_links ? fi->linkmode : fi->mode;
+		w += (S_ISREG(m) && m&S_IXUGO) || S_ISDIR(m) || S_ISLNK(m) ||
+			S_ISFIFO(m) || S_ISSOCK(m);
+	}
+	return w + fi->timeout;
+}
+
+static void fmt_name(struct out *out, const file_list *l, const file_info *fi) {
+	const struct ls_colors *lc = &l->lsc->colors;
+	int t;
+	const struct lsc_color *c;
+	if (fi->linkname && l->opts.follow_links) {
+		t = fi->linkok ? color_type(fi->linkmode) : L_ORPHAN;
+		c = file_color(lc, fi->linkname, fi->linkname_len, t);
+	} else {
+		t = color_type(fi->mode);
+		c = file_color(lc, fi->name, fi->name_len, t);
+	}
+	const struct lsc_color *sgr = c ? c : &l->lsc->reset;
+	out_sgr(out, sgr->s, sgr->len, &sgr->op);
+	out_text(out, fi->name, fi->name_len);
+	if (c) fs_write(&l->lsc->end, out);
+	if (l->opts.follow_links && fi->linkname) {
+		fs_write(&l->lsc->sym_delim, out);
+		out_sgr(out, sgr->s, sgr->len, &sgr->op);
+		out_text(out, fi->linkname, fi->linkname_len);
+		if (c) fs_write(&l->lsc->end, out);
+	}
+	if (!l->opts.no_classify) {
+		const struct lsc *lc = l->lsc;
+		mode_t m = fi->linkname && l->opts.follow_links ? fi->linkmode : fi->mode;
+		if (S_ISREG(m) && m&S_IXUGO) fs_write(&lc->cl_exec, out);
+		else if S_ISDIR(m) fs_write(&lc->cl_dir, out);
+		else if S_ISLNK(m) fs_write(&lc->cl_link, out);
+		else if S_ISFIFO(m) fs_write(&lc->cl_fifo, out);
+		else if S_ISSOCK(m) fs_write(&lc->cl_sock, out);
+	}
+	if (fi->timeout) fs_write(&l->lsc->cl_timeout, out);
+}
+
+static void fmt_usergroup(struct out *out, id_t id, const char *n, int w, int mw) {
+	char b[24];
+	if (n) out_text(out, n, strlen(n));
+	else out_text(out, b, snprintf(b, sizeof(b), "%d", id));
+	for (int n = mw - w + 1; n--;)
+		out_putc(out, ' ');
+}
+
+static void fmt_userinfo(struct out *out, file_list *l, file_info *fi) {
+	fs_write(&l->lsc->userinfo, out);
+	if (fi->timeout) {
+		fmt_usergroup(out, 0, "?", 1, l->uwidth);
+		fmt_usergroup(out, 0, "?", 1, l->gwidth);
+		return;
+	}
+	fmt_usergroup(out, fi->uid, getuser(l->lsc, fi->uid), fi->uwidth, l->uwidth);
+	fmt_usergroup(out, fi->gid, getgroup(l->lsc, fi->gid), fi->gwidth, l->gwidth);
+}
+
+static int fmt_file_width(file_list *l, file_info *fi) {
+	int w = 0;
+	if (l->opts.strmode)
+		w += 10 + 1;
+	if (l->userinfo)
+		w += fi->uwidth + 1 + fi->gwidth + 1;
+	if (l->opts.date == LSC_DATE_ABS)
+		w += 12 + 1;
+	if (l->opts.date == LSC_DATE_REL)
+		w += 3 + 1;
+	if (l->opts.size)
+		w += 4 + 1;
+	return w + fi->nwidth;
+}
+
+static void fmt_file(struct out *out, file_list *l, file_info *fi) {
+	if (l->opts.strmode)
+		fi->timeout ? fs_write(&l->lsc->unknown_mode, out) :
+			fmt_strmode(out, l->lsc, fi->mode);
+	if (l->userinfo)
+		fmt_userinfo(out, l, fi);
+	if (l->opts.date == LSC_DATE_ABS)
+		fi->timeout ? fs_write(&l->lsc->unknown_abstime, out) :
+			fmt_abstime(out, l, fi->time);
+	if (l->opts.date == LSC_DATE_REL)
+		fi->timeout ? fs_write(&l->lsc->unknown_reltime, out) :
+			fmt_reltime(out, l, fi->time);
+	if (l->opts.size)
+		fi->timeout ? fs_write(&l->lsc->unknown_size, out) :
+			fmt_size(out, l->lsc, fi->size);
+	fmt_name(out, l, fi);
+}
+
+struct grid { int *columns, x, y; };
+
+static bool grid_layout(struct grid *g, int direction, int padding,
+	int term_width, int max_width, int *widths, size_t widths_len)
+{
+	g->columns = 0;
+	int *cols = 0;
+	// iterate through numbers of rows, starting at upper bound
+	int n = (term_width - max_width) / (padding + max_width) + 1;
+	int upper_bound = (widths_len + n - 1) / n + 1;
+	for (int r = upper_bound; r >= 1; r--) {
+		// calculate number of columns for rows
+		int c = (widths_len + r - 1) / r;
+		// skip uninteresting rows
+		r = ((widths_len + c - 1) / c);
+		// total padding between columns
+		int total_separator_width = (c - 1) * padding;
+		// find maximum width in each column
+		cols = xrealloc(cols, c, sizeof(*cols));
+		memset(cols, 0, c * sizeof(*cols));
+		for (size_t i = 0; i < widths_len; i++) {
+			int ci = direction ? i % c : i / r;
+			cols[ci] = MAX(cols[ci], widths[i]);
+		}
+		// calculate total width of columns
+		int total = 0;
+		for (int i = 0; i < c; i++) total += cols[i];
+		// check if columns fit
+		if (total > term_width - total_separator_width)
+			break;
+		// store last layout that fits
+		int *tmp = g->columns;
+		g->columns = cols, cols = tmp;
+		g->x = c;
+		g->y = r;
+	}
+	if (cols) free(cols);
+	return !!g->columns;
+}
+
+static void fv_userwidths(file_list *v) {
+	for (size_t i = 0; i < v->len; i++) {
+		file_info *fi = fv_index(v, i);
+		const char *u = fi->timeout ? "?" : getuser(v->lsc, fi->uid);
+		const char *g = fi->timeout ? "?" : getgroup(v->lsc, fi->gid);
+		fi->uwidth = u ? strwidth(u) : snprintf(0, 0, "%d", fi->uid);
+		fi->gwidth = g ? strwidth(g) : snprintf(0, 0, "%d", fi->gid);
+		v->uwidth = MAX(fi->uwidth, v->uwidth);
+		v->gwidth = MAX(fi->gwidth, v->gwidth);
+	}
+}
+
+// sort the list once for any number of renderings
+static void fv_prepare(file_list *v) {
+	if (v->prepared) return;
+	fv_sort(v);
+	if (v->userinfo)
+		fv_userwidths(v);
+	v->prepared = true;
+}
+
+// sorted source for the merge, a spilled run or the list in memory; at and
+// next are offsets in f, or indexes in the list, of cur and what follows it
+struct run { FILE *f; off_t at, next; file_info fi, *cur; };
+
+static bool run_next(file_list *v, struct run *r) {
+	r->at = r->next;
+	if (!r->f) {
+		r->cur = (size_t)r->next < v->len ? fv_index(v, r->next++) : 0;
+		return r->cur;
+	}
+	if (r->cur) fi_free(&r->fi);
+	r->cur = 0;
+	// several merges may read the same run, each at its own offset
+	if (ftello(r->f) != r->next && fseeko(r->f, r->next, SEEK_SET) == -1) {
+		lsc_warn_errno(v, "%s", "cannot read temporary file");
+		v->failed = true;
+		return false;
+	}
+	if (run_read(v, r->f, &r->fi)) r->cur = &r->fi;
+	r->next = ftello(r->f);
+	return r->cur;
+}
+
+// k-way merge of the spilled runs
+struct merge {
+	file_list *l;
+	struct run *runs, **heap, *last;
+	size_t n, nruns;
+};
+
+static void run_sift(const file_list *l, struct run **h, size_t n, size_t i) {
+	for (;;) {
+		size_t m = i, a = 2*i + 1, b = a + 1;
+		if (a < n && fi_cmp(l, h[a]->cur, h[m]->cur) < 0) m = a;
+		if (b < n && fi_cmp(l, h[b]->cur, h[m]->cur) < 0) m = b;
+		if (m == i) return;
+		struct run *t = h[i];
+		h[i] = h[m], h[m] = t;
+		i = m;
+	}
+}
+
+// merge the given runs, and the list in memory if it is not empty
+static void merge_init(struct merge *m, file_list *v, const struct spilled *runs,
+	size_t nruns, const off_t *at)
+{
+	size_t n = nruns + !!v->len;
+	*m = (struct merge) {
+		.l = v,
+		.runs = xmalloc(n, sizeof(*m->runs)),
+		.heap = xmalloc(n, sizeof(*m->heap)),
+		.nruns = n,
+	};
+	for (size_t i = 0; i < n; i++) {
+		struct run *r = &m->runs[i];
+		*r = (struct run) {
+			.f = i < nruns ? runs[i].f : 0,
+			.next = at ? at[i] : 0,
+		};
+		if (r->next != -1 && run_next(v, r))
+			m->heap[m->n++] = r;
+	}
+	for (size_t i = m->n; i--;)
+		run_sift(v, m->heap, m->n, i);
+}
+
+// start merging with each run at the entry at[i] left it at, or -1 where it
+// was done, or from the beginning if at is NULL
+static void merge_start_at(struct merge *m, file_list *v, const off_t *at) {
+	if (v->nruns && v->len && v->opts.mem_limit) fv_spill(v);
+	merge_init(m, v, v->runs, v->nruns, at);
+}
+
+static void merge_start(struct merge *m, file_list *v) {
+	merge_start_at(m, v, 0);
+}
+
+// where each run is, for merge_start_at to resume from the current entry
+static void merge_tell(const struct merge *m, off_t *at) {
+	for (size_t i = 0; i < m->nruns; i++)
+		at[i] = m->runs[i].cur ? m->runs[i].at : -1;
+}
+
+// next entry in order, valid until the following call
+static file_info *merge_next(struct merge *m) {
+	if (m->last) {
+		if (!run_next(m->l, m->last))
+			m->heap[0] = m->heap[--m->n];
+		run_sift(m->l, m->heap, m->n, 0);
+	}
+	m->last = m->n ? m->heap[0] : 0;
+	return m->last ? m->last->cur : 0;
+}
+
+static void merge_end(struct merge *m) {
+	for (size_t i = 0; i < m->nruns; i++)
+		if (m->runs[i].f && m->runs[i].cur)
+			fi_free(&m->runs[i].fi);
+	free(m->heap);
+	free(m->runs);
+}
+
+// runs are merged RUNS_MERGE at a time into runs a level up, and at the
+// latest when there are RUNS_MAX of them, so that a merge never holds more
+// than that many files open and every entry is only copied a few times
+#define RUNS_MERGE 8
+#define RUNS_MAX 64
+
+static int fv_compact(file_list *v) {
+	while (v->nruns >= RUNS_MERGE) {
+		struct spilled *t = v->runs + v->nruns - RUNS_MERGE;
+		if (v->nruns < RUNS_MAX && t[0].level != t[RUNS_MERGE - 1].level)
+			return 0;
+		FILE *f = spill_open(v);
+		if (!f) {
+			v->opts.mem_limit = 0;
+			return -1;
+		}
+		struct merge m;
+		merge_init(&m, v, t, RUNS_MERGE, 0);
+		for (file_info *fi; (fi = merge_next(&m));)
+			run_write(f, fi, fi->nwidth);
+		merge_end(&m);
+		if (!run_flush(v, f)) {
+			v->opts.mem_limit = 0;
+			return -1;
+		}
+		for (size_t i = 0; i < RUNS_MERGE; i++)
+			fclose(t[i].f);
+		t[0] = (struct spilled) { f, t[0].level + 1 };
+		v->nruns -= RUNS_MERGE - 1;
+	}
+	return 0;
+}
+
+#define GRID_PADDING 2
+
+// render the entry in column x of a grid, padded unless it is the last
+static void fmt_cell(struct out *out, file_list *v, file_info *fi,
+	const struct grid *g, int x, int width)
+{
+	fmt_file(out, v, fi);
+	if (x != g->x - 1) {
+		int p = g->columns[x] - width + GRID_PADDING;
+		while (p--) out_putc(out, ' ');
+	}
+}
+
+// render rows [begin, end) of a grid, or lines of a list if g is NULL
+static void fmt_rows(struct out *out, file_list *v, size_t begin, size_t end,
+	const struct grid *g, const int *widths)
+{
+	int direction = v->opts.layout == LSC_LAYOUT_GRID_LINES;
+	for (size_t y = begin; y < end; y++) {
+		if (!g) {
+			fmt_file(out, v, fv_index(v, y));
+			out_putc(out, '\n');
+			continue;
+		}
+		for (int x = 0; x < g->x; x++) {
+			size_t i = direction ? y * g->x + x : g->y * x + y;
+			if (i >= v->len) continue;
+			fmt_cell(out, v, fv_index(v, i), g, x, widths[i]);
+		}
+		out_putc(out, '\n');
+	}
+}
+
+#define RENDER_MIN 4096   // lines before rendering goes parallel
+#define RENDER_CHUNK 512  // lines per chunk
+#define RENDER_AHEAD 4    // chunks per thread rendered ahead of the output
+#define RENDER_THREADS 64 // most threads used, whatever the cpu count
+
+// rows are rendered in chunks by worker threads into private buffers, and
+// written in order; each line starts from a reset SGR state, so chunks
+// render to the same bytes as they would in one stream
+struct render {
+	file_list *l;
+	const struct grid *g;
+	const int *widths;
+	size_t rows, chunk, nchunks, next, written, window;
+	struct render_chunk { struct out out; bool done; } *slots;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *render_run(void *p) {
+	struct render *r = p;
+	struct abstime *cache = calloc(ABSTIMES, sizeof(*cache));
+	assertx(cache);
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (r->next < r->nchunks && r->next >= r->written + r->window)
+			pthread_cond_wait(&r->cond, &r->lock);
+		if (r->next >= r->nchunks) break;
+		size_t k = r->next++;
+		pthread_mutex_unlock(&r->lock);
+		struct out out = OUT_INIT(0, r->l->opts.coalesce);
+		out.abstimes = cache;
+		size_t begin = k * r->chunk;
+		fmt_rows(&out, r->l, begin, MIN(begin + r->chunk, r->rows),
+			r->g, r->widths);
+		pthread_mutex_lock(&r->lock);
+		r->slots[k % r->window] = (struct render_chunk) { out, true };
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+	free(cache);
+	return 0;
+}
+
+static void fmt_rows_parallel(struct out *out, file_list *v, size_t rows,
+	const struct grid *g, const int *widths)
+{
+	size_t n = v->opts.threads, per_row = g ? g->x : 1;
+	if (n < 2 || rows * per_row < RENDER_MIN) {
+		fmt_rows(out, v, 0, rows, g, widths);
+		return;
+	}
+	struct render r = {
+		.l = v, .g = g, .widths = widths, .rows = rows,
+		.chunk = MAX(RENDER_CHUNK / per_row, 1),
+	};
+	r.nchunks = (rows + r.chunk - 1) / r.chunk;
+	n = MIN(n, r.nchunks);
+	r.window = n * RENDER_AHEAD;
+	r.slots = calloc(r.window, sizeof(*r.slots));
+	pthread_t *threads = xmalloc(n, sizeof(*threads));
+	assertx(r.slots);
+	pthread_mutex_init(&r.lock, 0);
+	pthread_cond_init(&r.cond, 0);
+	size_t started = 0;
+	while (started < n && !pthread_create(&threads[started], 0, render_run, &r))
+		started++;
+	pthread_mutex_lock(&r.lock);
+	for (size_t k = 0; k < r.nchunks; k++) {
+		struct render_chunk *c = &r.slots[k % r.window];
+		while (started && !c->done)
+			pthread_cond_wait(&r.cond, &r.lock);
+		if (!c->done) { // no threads, render the rest here
+			r.next = r.nchunks;
+			pthread_mutex_unlock(&r.lock);
+			fmt_rows(out, v, k * r.chunk, rows, g, widths);
+			pthread_mutex_lock(&r.lock);
+			break;
+		}
+		struct out o = c->out;
+		c->done = false;
+		r.written = k + 1;
+		pthread_cond_broadcast(&r.cond);
+		pthread_mutex_unlock(&r.lock);
+		out_raw(out, o.buf, o.len);
+		free(o.buf);
+		pthread_mutex_lock(&r.lock);
+	}
+	pthread_mutex_unlock(&r.lock);
+	for (size_t i = 0; i < started; i++)
+		pthread_join(threads[i], 0);
+	pthread_cond_destroy(&r.cond);
+	pthread_mutex_destroy(&r.lock);
+	free(threads);
+	free(r.slots);
+}
+
+// render n spilled entries as a grid; by lines the merge is already in
+// output order, by columns each column gets a merge of its own, resuming
+// where a first pass over the runs found the column's top entry
+static void fmt_spilled_grid(struct out *out, file_list *v, size_t n,
+	const struct grid *g, const int *widths)
+{
+	struct merge m;
+	merge_start(&m, v);
+	size_t cols = g->x, i = 0;
+	file_info *fi;
+	if (v->opts.layout == LSC_LAYOUT_GRID_LINES) {
+		for (; i < n && (fi = merge_next(&m)); i++) {
+			fmt_cell(out, v, fi, g, i % cols, widths[i]);
+			if (i % cols == cols - 1) out_putc(out, '\n');
+		}
+		if (i % cols) out_putc(out, '\n');
+		merge_end(&m);
+		return;
+	}
+	size_t k = m.nruns;
+	off_t *at = xmalloc(size_mul(cols, k), sizeof(*at));
+	for (size_t j = 0; j < cols * k; j++)
+		at[j] = -1;
+	for (; i < n && (fi = merge_next(&m)); i++)
+		if (i % g->y == 0)
+			merge_tell(&m, at + i / g->y * k);
+	merge_end(&m);
+	struct merge *ms = xmalloc(cols, sizeof(*ms));
+	for (size_t x = 0; x < cols; x++)
+		merge_start_at(&ms[x], v, at + x * k);
+	for (size_t y = 0; y < (size_t)g->y; y++) {
+		for (size_t x = 0; x < cols; x++) {
+			i = g->y * x + y;
+			if (i < n && (fi = merge_next(&ms[x])))
+				fmt_cell(out, v, fi, g, x, widths[i]);
+		}
+		out_putc(out, '\n');
+	}
+	for (size_t x = 0; x < cols; x++)
+		merge_end(&ms[x]);
+	free(ms);
+	free(at);
+}
+
+static void fmt_file_list(struct out *out, file_list *v) {
+	fv_prepare(v);
+	size_t n = v->len + v->spilled;
+	if (!n)
+		goto end;
+	if (v->opts.layout == LSC_LAYOUT_1LINE)
+		goto oneline;
+	for (size_t i = 0; i < v->len; i++) {
+		file_info *fi = fv_index(v, i);
+		fi->nwidth = fmt_name_width(v, fi);
+	}
+	// spilled entries keep their name width in the record, and only their
+	// widths are held in memory, unless even those are over the budget
+	if (v->nruns && v->opts.mem_limit &&
+		size_mul(n, sizeof(int)) > v->opts.mem_limit)
+		goto oneline;
+	int *widths = xmalloc(n, sizeof(int)), max_width = 0;
+	size_t i = 0;
+	if (v->nruns) {
+		struct merge m;
+		merge_start(&m, v);
+		for (file_info *fi; i < n && (fi = merge_next(&m)); i++)
+			widths[i] = fmt_file_width(v, fi);
+		merge_end(&m);
+		n = i;
+	} else {
+		for (; i < n; i++)
+			widths[i] = fmt_file_width(v, fv_index(v, i));
+	}
+	for (i = 0; i < n; i++)
+		max_width = MAX(max_width, widths[i]);
+	int term_width = v->opts.width ? v->opts.width : 80;
+	if (term_width < max_width) { // also for unknown widths
+		free(widths);
+		goto oneline;
+	}
+	int direction = v->opts.layout == LSC_LAYOUT_GRID_LINES;
+	struct grid g = {0};
+	bool grid = grid_layout(&g, direction, GRID_PADDING, term_width,
+		max_width, widths, n);
+	if (!grid) {
+		free(widths);
+		goto oneline;
+	}
+	if (v->nruns)
+		fmt_spilled_grid(out, v, n, &g, widths);
+	else
+		fmt_rows_parallel(out, v, g.y, &g, widths);
+	free(g.columns);
+	free(widths);
+	goto end;
+oneline:
+	if (v->nruns) {
+		struct merge m;
+		merge_start(&m, v);
+		for (file_info *fi; (fi = merge_next(&m));) {
+			fmt_file(out, v, fi);
+			out_putc(out, '\n');
+		}
+		merge_end(&m);
+	} else {
+		fmt_rows_parallel(out, v, v->len, 0, 0);
+	}
+end:
+	if (v->opts.stats) {
+		char b[24];
+		out_text(out, b, snprintf(b, sizeof(b), "%zu", v->len + v->spilled));
+		out_putc(out, '\n');
+	}
+}
+
+// copy a buffered rendering out like snprintf and release it
+static size_t out_copy(struct out *o, char *buf, size_t size) {
+	out_flush_sgr(o);
+	if (size) {
+		size_t n = MIN(o->len, size - 1);
+		if (n) memcpy(buf, o->buf, n);
+		buf[n] = '\0';
+	}
+	free(o->buf);
+	return o->len;
+}
+
+struct lsc *lsc_new(const char *ls_colors) {
+	struct lsc *c = calloc(1, sizeof(*c));
+	assertx(c);
+	c->env = strdup(ls_colors ? ls_colors : "");
+	assertx(c->env);
+	pthread_mutex_init(&c->lock, 0);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	c->cpus = cpus < 1 ? 1 : MIN(cpus, RENDER_THREADS);
+	lsc_parse(&c->colors, c->env);
+	fmt_init(c);
+	return c;
+}
+
+void lsc_free(struct lsc *c) {
+	if (!c) return;
+	pthread_mutex_destroy(&c->lock);
+	id_free(c->ucache);
+	id_free(c->gcache);
+	free(c->colors.map);
+	free(c->env);
+	free(c);
+}
+
+struct lsc_list *lsc_list_new(struct lsc *c, const struct lsc_options *o) {
+	file_list *l = calloc(1, sizeof(*l));
+	assertx(l);
+	l->lsc = c;
+	l->opts = *o;
+	l->opts.threads = MIN(o->threads, c->cpus);
+	for (const char *const *p = o->include; p && *p; p++)
+		nf_add(&l->include, *p);
+	for (const char *const *p = o->exclude; p && *p; p++)
+		nf_add(&l->exclude, *p);
+	nf_compile(&l->include);
+	nf_compile(&l->exclude);
+	l->filter = l->include.exts_len + l->include.globs_len +
+		l->exclude.exts_len + l->exclude.globs_len;
+	l->opts.include = l->opts.exclude = 0;
+	l->now = time(0);
+	l->uid = getuid();
+	l->gid = getgid();
+	l->at = AT_FDCWD;
+	if (o->total_timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &l->deadline);
+		ts_add_ms(&l->deadline, o->total_timeout);
+	}
+	fv_init(l, 64);
+	return l;
+}
+
+void lsc_list_free(struct lsc_list *l) {
+	if (!l) return;
+	sw_release(l);
+	fv_clear(l);
+	nf_free(&l->include);
+	nf_free(&l->exclude);
+	free(l->runs);
+	free(l->data);
+	free(l);
+}
+
+void lsc_list_clear(struct lsc_list *l) { fv_clear(l); }
+
+void lsc_list_at(struct lsc_list *l, int dirfd) { l->at = dirfd; }
+
+size_t lsc_list_len(const struct lsc_list *l) { return l->len + l->spilled; }
+
+int lsc_list_dir(struct lsc_list *l, const char *path) {
+	return ls_readdir(l, path);
+}
+
+int lsc_list_files(struct lsc_list *l, char *const *paths, int n,
+	const char **dirs)
+{
+	return ls_args(l, paths, n, dirs);
+}
+
+size_t lsc_render(struct lsc_list *l, char *buf, size_t size) {
+	struct out out = OUT_INIT(0, l->opts.coalesce);
+	fmt_file_list(&out, l);
+	return out_copy(&out, buf, size);
+}
+
+int lsc_render_file(struct lsc_list *l, FILE *f) {
+	struct out out = OUT_INIT(f, l->opts.coalesce);
+	fmt_file_list(&out, l);
+	out_flush_sgr(&out);
+	out_drain(&out);
+	free(out.buf);
+	return ferror(f) || l->failed ? -1 : 0;
+}
+
+struct lsc_iter {
+	file_list *l;
+	struct merge m;
+	file_info *cur;
+	struct lsc_entry e;
+};
+
+struct lsc_iter *lsc_iter_new(struct lsc_list *l) {
+	struct lsc_iter *it = calloc(1, sizeof(*it));
+	assertx(it);
+	it->l = l;
+	fv_prepare(l);
+	merge_start(&it->m, l);
+	return it;
+}
+
+const struct lsc_entry *lsc_iter_next(struct lsc_iter *it) {
+	file_info *fi = it->cur = merge_next(&it->m);
+	if (!fi) return 0;
+	it->e = (struct lsc_entry) {
+		.name = fi->name, .linkname = fi->linkname,
+		.mode = fi->mode, .linkmode = fi->linkmode,
+		.uid = fi->uid, .gid = fi->gid,
+		.time = fi->time, .size = fi->size,
+		.linkok = fi->linkok, .timeout = fi->timeout,
+	};
+	return &it->e;
+}
+
+size_t lsc_iter_render(struct lsc_iter *it, char *buf, size_t size) {
+	struct out out = OUT_INIT(0, it->l->opts.coalesce);
+	if (it->cur) fmt_file(&out, it->l, it->cur);
+	return out_copy(&out, buf, size);
+}
+
+void lsc_iter_free(struct lsc_iter *it) {
+	if (!it) return;
+	merge_end(&it->m);
+	free(it);
+}
@@ -0,0 +1,105 @@
+#ifndef LSC_H
+#define LSC_H
+
+// liblsc: sorted, classified and coloured file listings
+//
+// A struct lsc holds what is shared between listings: the parsed LS_COLORS
+// and the user/group name cache. Listings are built into a struct lsc_list
+// with their own options, then rendered or iterated over. Nothing is kept
+// in global state; a struct lsc can be shared between threads, each using
+// its own lists.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+enum lsc_sort { LSC_SORT_FVER, LSC_SORT_SIZE, LSC_SORT_TIME };
+enum lsc_uinfo { LSC_UINFO_NEVER, LSC_UINFO_AUTO, LSC_UINFO_ALWAYS };
+enum lsc_date { LSC_DATE_NONE, LSC_DATE_REL, LSC_DATE_ABS };
+enum lsc_layout {
+	LSC_LAYOUT_GRID_COLUMNS, LSC_LAYOUT_GRID_LINES, LSC_LAYOUT_1LINE,
+};
+
+struct lsc_options {
+	bool all;
+	bool dir;
+	bool m_time;
+	bool stats;
+	bool inode_order; // stat in inode order, faster on cold caches
+	// sorting
+	bool no_group_dir;
+	bool reverse;
+	enum lsc_sort sort;
+	// data/formatting
+	enum lsc_layout layout;
+	bool follow_links;
+	bool strmode;
+	enum lsc_uinfo userinfo;
+	enum lsc_date date;
+	bool size;
+	bool no_classify;
+	bool coalesce;
+	int width; // terminal width for grids, 0 for 80, negative if unknown
+	unsigned threads; // threads rendering large listings, at most the cpus
+	// filtering, NULL terminated lists of globs
+	const char *const *include, *const *exclude;
+	// memory budget before sorted runs are spilled to disk, 0 is unlimited;
+	// spilled listings too large for a grid within it are one per line
+	size_t mem_limit;
+	// milliseconds to wait for each entry's metadata, and for all of it
+	// from lsc_list_new; entries past them are shown as placeholders
+	unsigned stat_timeout, total_timeout;
+	// receives warnings, they go to stderr if this is NULL
+	void (*warn)(void *ctx, const char *msg);
+	void *warn_ctx;
+};
+
+struct lsc_entry {
+	const char *name, *linkname; // linkname is NULL unless a symlink
+	mode_t mode, linkmode;
+	uid_t uid;
+	gid_t gid;
+	time_t time;
+	off_t size;
+	bool linkok;
+	bool timeout; // metadata timed out, only the name is valid
+};
+
+struct lsc;
+struct lsc_list;
+struct lsc_iter;
+
+// ls_colors is in the format of $LS_COLORS and may be NULL
+struct lsc *lsc_new(const char *ls_colors);
+void lsc_free(struct lsc *c);
+
+struct lsc_list *lsc_list_new(struct lsc *c, const struct lsc_options *o);
+void lsc_list_free(struct lsc_list *l);
+void lsc_list_clear(struct lsc_list *l);
+size_t lsc_list_len(const struct lsc_list *l);
+
+// resolve relative paths against dirfd instead of the working directory
+void lsc_list_at(struct lsc_list *l, int dirfd);
+
+// add the entries of a directory, -1 if anything could not be listed
+int lsc_list_dir(struct lsc_list *l, const char *path);
+
+// add files given on a command line; directories are not added but stored
+// at their index in dirs, to be listed with lsc_list_dir
+int lsc_list_files(struct lsc_list *l, char *const *paths, int n,
+	const char **dirs);
+
+// render the sorted listing like snprintf, returns the length it needs
+size_t lsc_render(struct lsc_list *l, char *buf, size_t size);
+// -1 on write errors, or if entries spilled to disk could not be read back
+int lsc_render_file(struct lsc_list *l, FILE *f);
+
+// iterate over the sorted listing; entries are valid until the next call
+struct lsc_iter *lsc_iter_new(struct lsc_list *l);
+const struct lsc_entry *lsc_iter_next(struct lsc_iter *it);
+// render the current entry as one line, without newline, like snprintf
+size_t lsc_iter_render(struct lsc_iter *it, char *buf, size_t size);
+void lsc_iter_free(struct lsc_iter *it);
+
+#endif
@@ -0,0 +1,299 @@
+// microbenchmarks for the kernels in liblsc.c, over fixed generated corpora
+// so that no filesystem is involved
+//
+// usage: lsc-bench [baseline]
+// prints one line per kernel with ns/op and cycles/byte; given the output
+// of an earlier run, each line also shows the change in ns/op against it
+
+#include "liblsc.c"
+
+#include <locale.h>
+
+#define NAMES 4096
+#define GRID_WIDTHS 512
+#define MIN_NS 50000000 // calibrate each kernel to at least 50ms
+#define RUNS 5          // and report the best of this many runs
+
+static const char *colors =
+	"rs=0:di=01;34:ln=01;36:mh=00:pi=40;33:so=01;35:do=01;35:bd=40;33;01:"
+	"cd=40;33;01:or=40;31;01:mi=00:su=37;41:sg=30;43:ca=30;41:tw=30;42:"
+	"ow=34;42:st=37;44:ex=01;32:*.tar=01;31:*.tgz=01;31:*.arc=01;31:"
+	"*.arj=01;31:*.taz=01;31:*.lha=01;31:*.lz4=01;31:*.lzh=01;31:"
+	"*.lzma=01;31:*.tlz=01;31:*.txz=01;31:*.tzo=01;31:*.t7z=01;31:"
+	"*.zip=01;31:*.z=01;31:*.dz=01;31:*.gz=01;31:*.lrz=01;31:*.lz=01;31:"
+	"*.lzo=01;31:*.xz=01;31:*.zst=01;31:*.tzst=01;31:*.bz2=01;31:"
+	"*.bz=01;31:*.tbz=01;31:*.tbz2=01;31:*.tz=01;31:*.deb=01;31:"
+	"*.rpm=01;31:*.jar=01;31:*.war=01;31:*.ear=01;31:*.sar=01;31:"
+	"*.rar=01;31:*.alz=01;31:*.ace=01;31:*.zoo=01;31:*.cpio=01;31:"
+	"*.7z=01;31:*.rz=01;31:*.cab=01;31:*.wim=01;31:*.swm=01;31:"
+	"*.dwm=01;31:*.esd=01;31:*.jpg=01;35:*.jpeg=01;35:*.mjpg=01;35:"
+	"*.mjpeg=01;35:*.gif=01;35:*.bmp=01;35:*.pbm=01;35:*.pgm=01;35:"
+	"*.ppm=01;35:*.tga=01;35:*.xbm=01;35:*.xpm=01;35:*.tif=01;35:"
+	"*.tiff=01;35:*.png=01;35:*.svg=01;35:*.svgz=01;35:*.mng=01;35:"
+	"*.pcx=01;35:*.mov=01;35:*.mpg=01;35:*.mpeg=01;35:*.m2v=01;35:"
+	"*.mkv=01;35:*.webm=01;35:*.webp=01;35:*.ogm=01;35:*.mp4=01;35:"
+	"*.m4v=01;35:*.mp4v=01;35:*.vob=01;35:*.qt=01;35:*.nuv=01;35:"
+	"*.wmv=01;35:*.asf=01;35:*.rm=01;35:*.rmvb=01;35:*.flc=01;35:"
+	"*.avi=01;35:*.fli=01;35:*.flv=01;35:*.gl=01;35:*.dl=01;35:"
+	"*.xcf=01;35:*.xwd=01;35:*.yuv=01;35:*.cgm=01;35:*.emf=01;35:"
+	"*.ogv=01;35:*.ogx=01;35:*.aac=00;36:*.au=00;36:*.flac=00;36:"
+	"*.m4a=00;36:*.mid=00;36:*.midi=00;36:*.mka=00;36:*.mp3=00;36:"
+	"*.mpc=00;36:*.ogg=00;36:*.ra=00;36:*.wav=00;36:*.oga=00;36:"
+	"*.opus=00;36:*.spx=00;36:*.xspf=00;36:*.c=01;35:*.h=01;35:"
+	"*.txt=00;36:*.md=00;36:*.log=00;33:";
+
+static const char *names[NAMES];
+static int name_lens[NAMES], name_sufs[NAMES];
+static off_t sizes[NAMES];
+static time_t times[NAMES];
+static size_t name_bytes;
+static volatile size_t sink;
+
+static uint32_t rng = 2463534242u;
+
+static uint32_t next(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void corpus_init(void) {
+	static const char *const fmts[] = {
+		"file%u.txt", "v%u.%u.%u.tar.gz", ".config%u", "IMG_%04u.JPG",
+		"\xc3\x9c" "n" "\xc3\xaf" "c" "\xc3\xb6" "d" "\xc3\xa9" "-%u.c",
+		"\xe6\x97\xa5\xe6\x9c\xac%u.md",
+		"libfoo.so.%u.%u", "README%u", "backup-%u~", "photo %u (%u).png",
+		"linux-%u.%u.%u", "x%u.o",
+	};
+	for (size_t i = 0; i < NAMES; i++) {
+		char b[64];
+		const char *f = fmts[next() % (sizeof(fmts) / sizeof(*fmts))];
+		snprintf(b, sizeof(b), f, next() % 1000, next() % 20, next() % 100);
+		names[i] = strdup(b);
+		name_lens[i] = strlen(b);
+		name_sufs[i] = suf_index(b, name_lens[i]);
+		name_bytes += name_lens[i];
+		sizes[i] = (off_t)next() >> (next() % 32);
+		times[i] = (time_t)1700000000 - (time_t)(next() >> (next() % 32));
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static uint64_t cycles(void) { return __builtin_ia32_rdtsc(); }
+#else
+static uint64_t cycles(void) { return 0; }
+#endif
+
+static uint64_t nanos(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// a kernel runs n ops and returns the number of bytes they went through
+typedef size_t kernel(size_t n);
+
+static size_t k_filevercmp(size_t n) {
+	size_t bytes = 0;
+	int r = 0;
+	for (size_t k = 0; k < n; k++) {
+		size_t i = k % (NAMES - 1);
+		r += filevercmp(names[i], name_lens[i], name_sufs[i],
+			names[i + 1], name_lens[i + 1], name_sufs[i + 1]);
+		bytes += name_lens[i] + name_lens[i + 1];
+	}
+	sink += r;
+	return bytes;
+}
+
+static size_t k_suf_index(size_t n) {
+	size_t bytes = 0, r = 0;
+	for (size_t k = 0; k < n; k++) {
+		size_t i = k % NAMES;
+		r += suf_index(names[i], name_lens[i]);
+		bytes += name_lens[i];
+	}
+	sink += r;
+	return bytes;
+}
+
+static size_t k_strwidth(size_t n) {
+	size_t bytes = 0, r = 0;
+	for (size_t k = 0; k < n; k++) {
+		size_t i = k % NAMES;
+		r += strwidth(names[i]);
+		bytes += name_lens[i];
+	}
+	sink += r;
+	return bytes;
+}
+
+static size_t k_grid_layout(size_t n) {
+	static int widths[GRID_WIDTHS];
+	int max_width = 0;
+	for (size_t i = 0; i < GRID_WIDTHS; i++) {
+		widths[i] = name_lens[i] + 1;
+		max_width = MAX(max_width, widths[i]);
+	}
+	for (size_t k = 0; k < n; k++) {
+		struct grid g = {0};
+		if (grid_layout(&g, k & 1, 2, 160, max_width, widths, GRID_WIDTHS))
+			sink += g.x;
+		free(g.columns);
+	}
+	return n * sizeof(widths);
+}
+
+static size_t k_lsc_parse(size_t n) {
+	size_t len = strlen(colors);
+	char *env = xmalloc(len + 1, 1);
+	for (size_t k = 0; k < n; k++) {
+		struct ls_colors lc = {0};
+		memcpy(env, colors, len + 1);
+		lsc_parse(&lc, env);
+		sink += lc.exts;
+		free(lc.map);
+	}
+	free(env);
+	return n * len;
+}
+
+static struct lsc *lsc;
+
+static size_t k_lsc_lookup(size_t n) {
+	size_t bytes = 0;
+	for (size_t k = 0; k < n; k++) {
+		size_t i = k % NAMES;
+		sink += !!suf_color(&lsc->colors, names[i], name_lens[i]);
+		bytes += name_lens[i];
+	}
+	return bytes;
+}
+
+static size_t k_fmt_size(size_t n) {
+	struct out out = OUT_INIT(0, false);
+	size_t bytes = 0;
+	for (size_t k = 0; k < n; k++) {
+		out.len = 0;
+		fmt_size(&out, lsc, sizes[k % NAMES]);
+		bytes += out.len;
+	}
+	free(out.buf);
+	return bytes;
+}
+
+static file_list *list;
+
+static size_t k_fmt_reltime(size_t n) {
+	struct out out = OUT_INIT(0, false);
+	size_t bytes = 0;
+	for (size_t k = 0; k < n; k++) {
+		out.len = 0;
+		fmt_reltime(&out, list, times[k % NAMES]);
+		bytes += out.len;
+	}
+	free(out.buf);
+	return bytes;
+}
+
+static file_info infos[NAMES];
+
+// one op sorts the whole corpus
+static size_t k_fi_sort(size_t n) {
+	for (size_t k = 0; k < n; k++) {
+		memcpy(list->data, infos, sizeof(infos));
+		list->len = NAMES;
+		fv_sort(list);
+		sink += list->data[0].name_len;
+	}
+	list->len = 0;
+	return n * name_bytes;
+}
+
+static const struct {
+	const char *name;
+	kernel *fn;
+} kernels[] = {
+	{ "filevercmp",  k_filevercmp },
+	{ "suf_index",   k_suf_index },
+	{ "strwidth",    k_strwidth },
+	{ "grid_layout", k_grid_layout },
+	{ "lsc_parse",   k_lsc_parse },
+	{ "lsc_lookup",  k_lsc_lookup },
+	{ "fmt_size",    k_fmt_size },
+	{ "fmt_reltime", k_fmt_reltime },
+	{ "fi_sort",     k_fi_sort },
+};
+
+#define KERNELS (sizeof(kernels) / sizeof(*kernels))
+
+// ns/op of each kernel in a saved run, 0 where missing
+static double baseline[KERNELS];
+
+static void read_baseline(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) die_errno("%s", path);
+	char line[256], name[64];
+	double ns;
+	while (fgets(line, sizeof(line), f))
+		if (line[0] != '#' && sscanf(line, "%63s %lf", name, &ns) == 2)
+			for (size_t i = 0; i < KERNELS; i++)
+				if (!strcmp(name, kernels[i].name))
+					baseline[i] = ns;
+	fclose(f);
+}
+
+int main(int argc, char **argv) {
+	setlocale(LC_ALL, "C.UTF-8");
+	if (argc > 2) {
+		log("usage: %s [baseline]", argv[0]);
+		return 2;
+	}
+	if (argc == 2) read_baseline(argv[1]);
+	corpus_init();
+	lsc = lsc_new(colors);
+	struct lsc_options o = {0};
+	list = lsc_list_new(lsc, &o);
+	list->now = 1700000000;
+	list->data = xrealloc(list->data, NAMES, sizeof(*list->data));
+	list->cap = NAMES;
+	for (size_t i = 0; i < NAMES; i++) {
+		infos[i] = (file_info) {
+			.name = names[i], .name_len = name_lens[i],
+			.name_suf = name_sufs[i], .linkok = true,
+			.mode = i % 7 ? S_IFREG : S_IFDIR,
+			.size = sizes[i], .time = times[i],
+		};
+	}
+	printf("# %-12s %10s %11s%s\n", "kernel", "ns/op", "cycles/byte",
+		argc == 2 ? "  vs baseline" : "");
+	for (size_t i = 0; i < KERNELS; i++) {
+		size_t n = 1;
+		while (1) {
+			uint64_t t = nanos();
+			kernels[i].fn(n);
+			if (nanos() - t >= MIN_NS / 10) break;
+			n *= 2;
+		}
+		n *= 10;
+		double best = 0, cpb = 0;
+		for (int r = 0; r < RUNS; r++) {
+			uint64_t c = cycles(), t = nanos();
+			size_t bytes = kernels[i].fn(n);
+			t = nanos() - t, c = cycles() - c;
+			double ns = (double)t / n;
+			if (!r || ns < best) {
+				best = ns;
+				cpb = bytes ? (double)c / bytes : 0;
+			}
+		}
+		printf("%-14s %10.2f %11.3f", kernels[i].name, best, cpb);
+		if (baseline[i])
+			printf("  %+11.1f%%", (best / baseline[i] - 1) * 100);
+		putchar('\n');
+	}
+	lsc_list_free(list);
+	lsc_free(lsc);
+	return 0;
+}